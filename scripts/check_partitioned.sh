@@ -0,0 +1,71 @@
+#!/usr/bin/env bash
+# Run the ranking on the wat_parser/small sample in standalone mode and with 2 workers
+# (+ a coordinator) on unix sockets, and check that both runs publish the same values.
+# Both runs are synchronous (they only read the values of the previous iteration), else the
+# results depend on the update order and on the number of workers.
+#
+# usage: WORKER_DB=<connection string> scripts/check_partitioned.sh [path/to/graphchi_handler]
+#
+# WORKER_DB must be a scratch database: its scores table is recreated from the sample
+# (set SKIP_DB_LOAD=1 to use the scores already there).
+set -euo pipefail
+
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+BIN=$(realpath "${1:-$ROOT/bin/graphchi_handler}")
+SAMPLE="$ROOT/wat_parser/small"
+NITERS=${NITERS:-4}
+WORKDIR=$(mktemp -d)
+trap 'kill $(jobs -p) 2>/dev/null || true; rm -rf "$WORKDIR"' EXIT
+
+python3 "$ROOT/scripts/sample_graph.py" "$SAMPLE" "$WORKDIR/edges.csv" "$WORKDIR/scores.tsv"
+
+if [ "${SKIP_DB_LOAD:-0}" != 1 ]; then
+    psql "$WORKER_DB" -v ON_ERROR_STOP=1 -q \
+        -c "DROP TABLE IF EXISTS scores" \
+        -c "CREATE TABLE scores (url text, trustrank real, pornrank real)" \
+        -c "\\copy scores FROM '$WORKDIR/scores.tsv'"
+fi
+
+OPTS=(--worker_db="$WORKER_DB" --link_db="$WORKDIR/edges.csv" --niters="$NITERS" --synchronous=1)
+WORKERS="unix:$WORKDIR/w0.sock,unix:$WORKDIR/w1.sock"
+
+mkdir "$WORKDIR/standalone" "$WORKDIR/partitioned"
+(cd "$WORKDIR/standalone" && "$BIN" --mode=standalone "${OPTS[@]}" > out.txt 2> log.txt)
+
+cd "$WORKDIR/partitioned"
+"$BIN" --mode=worker --worker_id=0 --workers="$WORKERS" > w0.txt 2>&1 &
+W0=$!
+"$BIN" --mode=worker --worker_id=1 --workers="$WORKERS" > w1.txt 2>&1 &
+W1=$!
+"$BIN" --mode=coordinator --workers="$WORKERS" "${OPTS[@]}" > out.txt 2> log.txt
+wait $W0 $W1
+cd "$ROOT"
+
+for sock in "$WORKDIR/w0.sock" "$WORKDIR/w1.sock"; do
+    if [ -e "$sock" ]; then
+        echo "$sock was not removed by its worker" >&2
+        exit 1
+    fi
+done
+
+python3 - "$WORKDIR/standalone/out.txt" "$WORKDIR/partitioned/out.txt" <<'PY'
+import re, sys
+pattern = re.compile(r' for graphchi id (\d+) uuid (\S+) value = pr: (\S+), trust: (\S+), porn: (\S+)$')
+def read(path):
+    res = {}
+    for line in open(path):
+        m = pattern.match(line.rstrip('\n'))
+        if m:
+            res[m.group(2)] = [float(v) for v in m.group(3, 4, 5)]
+    return res
+standalone, partitioned = read(sys.argv[1]), read(sys.argv[2])
+if not standalone or standalone.keys() != partitioned.keys():
+    sys.exit('the runs do not publish the same vertices (%d vs %d)' % (len(standalone), len(partitioned)))
+errors = [(uuid, standalone[uuid], partitioned[uuid]) for uuid in standalone
+          if any(abs(a - b) > 1e-4 * max(1.0, abs(a)) for a, b in zip(standalone[uuid], partitioned[uuid]))]
+for uuid, a, b in errors[:10]:
+    print('%s: standalone %s, partitioned %s' % (uuid, a, b), file=sys.stderr)
+if errors:
+    sys.exit('%d vertices differ' % len(errors))
+print('ok: %d vertices, same values in standalone and partitioned runs' % len(standalone))
+PY
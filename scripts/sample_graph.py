@@ -0,0 +1,83 @@
+#!/usr/bin/env python3
+"""
+Build a small test graph from a wat file (wat_parser/small): the WARC-Target-URI of a record
+links to the url of each of its Links, like in wat_parser.
+
+usage: sample_graph.py <wat file> <edges.csv> <scores.tsv> [labels]
+
+edges.csv is the link_db input ("from,to" lines), scores.tsv the content of the scores table
+(url, trustrank, pornrank, \\N for null). The labels are:
+  single: the first url is a trust seed, the second one a porn seed (default)
+  many:   every url is a trust seed, a few vertices (some without out-edges) are porn seeds
+  other:  every third url is a trust seed of weight 3, the fourth url a porn seed
+"""
+import json
+import sys
+
+
+def read_graph(sample):
+    urls, edges = [], []
+    known = set()
+
+    def add_url(url):
+        if url not in known:
+            known.add(url)
+            urls.append(url)
+
+    def valid(url):
+        return url and len(url) > 6 and not any(c in url for c in ',\t\n\\')
+
+    for line in open(sample, encoding='utf-8', errors='replace'):
+        if not line.startswith('{'):
+            continue
+        envelope = json.loads(line)['Envelope']
+        source = envelope['WARC-Header-Metadata'].get('WARC-Target-URI')
+        links = envelope.get('Payload-Metadata', {}).get('HTTP-Response-Metadata', {}) \
+                        .get('HTML-Metadata', {}).get('Links', [])
+        if not valid(source):
+            continue
+        add_url(source)
+        for link in links:
+            if valid(link.get('url')):
+                add_url(link['url'])
+                edges.append((source, link['url']))
+    return urls, edges
+
+
+def labels(kind, urls, edges):
+    sources = set(source for source, _ in edges)
+    trust, porn = {}, {}
+    if kind == 'single':
+        trust[urls[0]] = 1
+        porn[urls[1]] = 1
+    elif kind == 'many':
+        trust = dict((url, 1) for url in urls)
+        dangling = [url for url in urls if url not in sources]
+        for url in [urls[0]] + dangling[:3]:
+            porn[url] = 2
+        porn[dangling[3]] = 0.5
+    elif kind == 'other':
+        trust = dict((url, 3) for url in urls[::3])
+        porn[urls[3]] = 1
+    else:
+        sys.exit('unknown labels ' + kind)
+    return trust, porn
+
+
+def main():
+    sample, edges_file, scores_file = sys.argv[1:4]
+    kind = sys.argv[4] if len(sys.argv) > 4 else 'single'
+    urls, edges = read_graph(sample)
+    trust, porn = labels(kind, urls, edges)
+    with open(edges_file, 'w') as f:
+        for source, target in edges:
+            f.write('%s,%s\n' % (source, target))
+    null = '\\N'
+    with open(scores_file, 'w') as f:
+        for url in urls:
+            f.write('%s\t%s\t%s\n' % (url, trust.get(url, null), porn.get(url, null)))
+    print('%d vertices, %d edges' % (len(urls), len(edges)), file=sys.stderr)
+
+
+if __name__ == '__main__':
+    main()
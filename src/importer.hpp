@@ -4,10 +4,12 @@
 #include <graphchi_basic_includes.hpp>
 #include <preprocessing/sharder.hpp>
 #include <pqxx/pqxx>
+#include <stxxl/sort>
 #include "deps/MurmurHash3.h"
 #include "objects.hpp"
 
 const std::string FILE_NAME = "graphchi";
+const uint64_t SORT_MEMORY = 512 * 1024 * 1024; // memory given to the external sorts of the edges
 
 uuid_t mm3(const std::string& val) {
     uuid_t hash;
@@ -24,6 +26,13 @@ uuid_t read_id(const pqxx::tuple& row) {
     return mm3(url);
 }
 
+float get_nullable(const pqxx::result::field& val) {
+    if (val.is_null()) {
+        return {};
+    }
+    return val.as<float>();
+}
+
 uint64_t fetch_vertices(Context& ctx, const std::string& worker_db_cnx) {
     pqxx::connection c(worker_db_cnx);
     pqxx::work transaction(c);
@@ -35,13 +44,6 @@ uint64_t fetch_vertices(Context& ctx, const std::string& worker_db_cnx) {
         ctx.id_map[id] = num_vertices;
         ctx.vertices_uuid.push_back(id);
 
-        const auto get_nullable = [](const pqxx::result::field& val) -> float {
-            if (val.is_null()) {
-                return {};
-            }
-            return val.as<float>();
-        };
-
         ctx.vertices_data.push_back(VertexDataType{
             0,
             get_nullable(row["trustrank"]),
@@ -55,7 +57,8 @@ uint64_t fetch_vertices(Context& ctx, const std::string& worker_db_cnx) {
     return num_vertices;
 }
 
-void add_edge(const VerticesIdMap& id_map, graphchi::sharder<EdgeDataType>& sharder, const uuid_t& from, const uuid_t& to) {
+template <typename OnEdge>
+void add_edge(const VerticesIdMap& id_map, const uuid_t& from, const uuid_t& to, OnEdge&& on_edge) {
     auto from_it = id_map.find(from);
     if (from_it == id_map.end()) {
         std::cerr << "impossible to find " << from << " source node, skipping edge" << std::endl;
@@ -69,10 +72,14 @@ void add_edge(const VerticesIdMap& id_map, graphchi::sharder<EdgeDataType>& shar
     }
     const uint64_t to_idx = to_it->second;
     std::cout <<" add edge " << from_idx << " -> " << to_idx <<  std::endl;
-    sharder.preprocessing_add_edge(from_idx, to_idx);
+    on_edge(from_idx, to_idx);
 }
 
-void fetch_edges(const VerticesIdMap& id_map, const std::string& link_db_cnx, graphchi::sharder<EdgeDataType>& sharder) {
+/**
+  * Read all the edges and call on_edge(from_idx, to_idx) for each of them.
+  */
+template <typename OnEdge>
+void fetch_edges(const VerticesIdMap& id_map, const std::string& link_db_cnx, OnEdge&& on_edge) {
 
     // for the moment we read a dump edge file
     std::ifstream file{link_db_cnx, std::fstream::in};
@@ -87,18 +94,19 @@ void fetch_edges(const VerticesIdMap& id_map, const std::string& link_db_cnx, gr
         const uuid_t to = mm3(to_url);
         std::cout << from_url << " (" << from << ") -> " << to_url << " (" << to << ")" << std::endl;
 
-        add_edge(id_map, sharder, from, to);
+        add_edge(id_map, from, to, on_edge);
     }
 }
 
-int fetch_edges_and_shard(const VerticesIdMap& id_map, 
-                            const std::string& link_db_cnx, 
-                            const uint64_t num_vertices, 
-                            const std::string& nshards_string) {
-    graphchi::sharder<EdgeDataType> sharder(FILE_NAME);
+/**
+  * Create the shards of the graph, fill(sharder) adds the edges and returns the number of vertices.
+  */
+template <typename Fill>
+int shard(const std::string& filename, const std::string& nshards_string, Fill&& fill) {
+    graphchi::sharder<EdgeDataType> sharder(filename);
     sharder.start_preprocessing();
 
-    fetch_edges(id_map, link_db_cnx, sharder);
+    const uint64_t num_vertices = fill(sharder);
 
     sharder.end_preprocessing();
 
@@ -110,9 +118,82 @@ int fetch_edges_and_shard(const VerticesIdMap& id_map,
     return nshards;
 }
 
+// files stored next to the shards by a personalized run, and reused by a labels only run
+std::string out_offsets_file(const std::string& filename) { return filename + ".out_offsets"; }
+std::string out_targets_file(const std::string& filename) { return filename + ".out_targets"; }
+std::string uuids_file(const std::string& filename) { return filename + ".uuids"; }
+
+void load_out_edges(const std::string& filename, OutEdges& out_edges) {
+    out_edges.offsets.map(out_offsets_file(filename));
+    out_edges.targets.map(out_targets_file(filename));
+}
+
+template <typename T>
+void write_pod(std::ofstream& file, const T& val) {
+    file.write(reinterpret_cast<const char*>(&val), sizeof(T));
+}
+
+/**
+  * Build the CSR out-edges from the raw edge list (sorted in place), write them next to the shards and map them.
+  */
+void build_out_edges(EdgeList& edges, const uint64_t num_vertices, const std::string& filename, OutEdges& out_edges) {
+    stxxl::sort(edges.begin(), edges.end(), EdgeCompare(), SORT_MEMORY);
+
+    std::ofstream offsets{out_offsets_file(filename), std::ios::binary | std::ios::trunc};
+    std::ofstream targets{out_targets_file(filename), std::ios::binary | std::ios::trunc};
+
+    uint64_t current = 0;
+    uint64_t nb_edges = 0;
+    write_pod<uint64_t>(offsets, 0);
+    for (auto it = edges.cbegin(); it != edges.cend(); ++it) {
+        const Edge e = *it;
+        while (current < e.first) {
+            write_pod(offsets, nb_edges);
+            current++;
+        }
+        write_pod<uint64_t>(targets, e.second);
+        nb_edges++;
+    }
+    while (current < num_vertices) {
+        write_pod(offsets, nb_edges);
+        current++;
+    }
+    offsets.close();
+    targets.close();
+    if (! offsets || ! targets) {
+        throw std::runtime_error("impossible to write the out-edges of " + filename);
+    }
+    logstream(LOG_INFO) << "Built out-edges for " << num_vertices << " vertices and " 
+                        << nb_edges << " edges" << std::endl;
+    load_out_edges(filename, out_edges);
+}
+
+int fetch_edges_and_shard(const VerticesIdMap& id_map, 
+                            const std::string& link_db_cnx, 
+                            const uint64_t num_vertices, 
+                            const std::string& nshards_string,
+                            OutEdges* out_edges = nullptr) {
+    // the edges are only kept aside if someone needs to walk the out-edges outside of graphchi
+    EdgeList kept_edges;
+    const int nshards = shard(FILE_NAME, nshards_string, [&](graphchi::sharder<EdgeDataType>& sharder) {
+        fetch_edges(id_map, link_db_cnx, [&](const uint64_t from_idx, const uint64_t to_idx) {
+            sharder.preprocessing_add_edge(from_idx, to_idx);
+            if (out_edges) {
+                kept_edges.push_back(Edge{from_idx, to_idx});
+            }
+        });
+        return num_vertices;
+    });
+    if (out_edges) {
+        build_out_edges(kept_edges, num_vertices, FILE_NAME, *out_edges);
+    }
+    return nshards;
+}
+
 int fetch_data(Context& ctx, const std::string& nshards_string, 
                 const std::string& worker_db_cnx, 
-                const std::string& link_db_cnx) {
+                const std::string& link_db_cnx,
+                const bool keep_out_edges = false) {
     // for the moment we always create new shards
     logstream(LOG_INFO) << "create sharding now..." << std::endl;
 
@@ -120,6 +201,58 @@ int fetch_data(Context& ctx, const std::string& nshards_string,
     const auto num_vertices = fetch_vertices(ctx, worker_db_cnx);
 
     // we get all the edges from the link database and use the id_map to set their id
-    const int nshards = fetch_edges_and_shard(ctx.id_map, link_db_cnx, num_vertices, nshards_string);
+    const int nshards = fetch_edges_and_shard(ctx.id_map, link_db_cnx, num_vertices, nshards_string, 
+                                              keep_out_edges ? &ctx.out_edges : nullptr);
+    if (keep_out_edges) {
+        // the graphchi ids depend on the order of the scores table, they are kept for a labels only run
+        std::ofstream uuids{uuids_file(FILE_NAME), std::ios::binary | std::ios::trunc};
+        for (auto it = ctx.vertices_uuid.cbegin(); it != ctx.vertices_uuid.cend(); ++it) {
+            write_pod(uuids, *it);
+        }
+        uuids.close();
+        if (! uuids) {
+            throw std::runtime_error("impossible to write the vertices uuids of " + FILE_NAME);
+        }
+    }
     return nshards;
 }
+
+/**
+  * Labels only run: reuse the vertices and out-edges of the previous personalized run,
+  * only the labels are read from the database. No import, no sharding.
+  */
+void fetch_labels(Context& ctx, const std::string& worker_db_cnx) {
+    std::ifstream uuids{uuids_file(FILE_NAME), std::ios::binary};
+    if (! uuids) {
+        throw std::runtime_error("no previous personalized run found (missing " + uuids_file(FILE_NAME) + ")");
+    }
+    uuid_t id;
+    uint64_t num_vertices = 0;
+    while (uuids.read(reinterpret_cast<char*>(&id), sizeof(id))) {
+        ctx.id_map[id] = num_vertices++;
+        ctx.vertices_uuid.push_back(id);
+        ctx.vertices_data.push_back(VertexDataType{0, 0, 0});
+    }
+    load_out_edges(FILE_NAME, ctx.out_edges);
+    if (ctx.out_edges.offsets.size() != num_vertices + 1) {
+        throw std::runtime_error("the out-edges of " + FILE_NAME + " do not match its vertices");
+    }
+
+    pqxx::connection c(worker_db_cnx);
+    pqxx::work transaction(c);
+
+    auto results = transaction.exec("SELECT * FROM scores");
+    for (const auto& row: results) {
+        const uuid_t id = read_id(row);
+        auto it = ctx.id_map.find(id);
+        if (it == ctx.id_map.end()) {
+            std::cerr << "impossible to find " << id << " in the previous run, a full run is needed for new vertices, skipping" << std::endl;
+            continue;
+        }
+        VertexDataType data = ctx.vertices_data[it->second];
+        data.trust_rank = get_nullable(row["trustrank"]);
+        data.porn_rank = get_nullable(row["pornrank"]);
+        ctx.vertices_data[it->second] = data;
+    }
+    logstream(LOG_INFO) << "Read the labels of " << num_vertices << " vertices" << std::endl;
+}
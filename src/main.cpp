@@ -6,6 +6,8 @@
 #include "util/toplist.hpp"
 #include "importer.hpp"
 #include "objects.hpp"
+#include "personalized.hpp"
+#include "partition.hpp"
 
 #define THRESHOLD 1e-1    
 #define RANDOMRESETPROB 0.15
@@ -23,17 +25,40 @@ using graphchi::vid_t;
 
 struct PagerankProgram : public GraphChiProgram<VertexDataType, EdgeDataType> {
     VerticesData& vertices_data;
-    PagerankProgram(VerticesData& d): vertices_data(d) {}
+    bool label_propagation; // if false trust/porn ranks have already been computed (personalized mode) and are kept as is
+    bool synchronous; // if true the update only reads the values of the previous iteration
+    VerticesData previous_data{}; // values of the previous iteration, only filled in synchronous mode
+    Partition* partition; // only set in partitioned mode
+    PagerankProgram(VerticesData& d, bool label_propagation = true, bool synchronous = false, Partition* partition = nullptr): 
+        vertices_data(d), label_propagation(label_propagation), synchronous(synchronous), partition(partition) {}
+
+    /**
+      * In partitioned mode graphchi only knows the local edges, the global degree is given by the coordinator.
+      */
+    int out_degree(graphchi_vertex<VertexDataType, EdgeDataType> &v) const {
+        return partition ? partition->out_degree(v.id()) : v.outc;
+    }
+
     /**
-      * Called before an iteration starts. Not implemented.
+      * Called before an iteration starts.
+      * In synchronous mode the values are double buffered, so the result does not depend on the order 
+      * in which the vertices are updated, nor on the number of workers in partitioned mode.
       */
     void before_iteration(int iteration, graphchi_context &info) {
+        if (synchronous) {
+            previous_data.resize(vertices_data.size());
+            std::copy(vertices_data.cbegin(), vertices_data.cend(), previous_data.begin());
+        }
     }
     
     /**
-      * Called after an iteration has finished. Not implemented.
+      * Called after an iteration has finished. 
+      * In partitioned mode the boundary values are exchanged with the other workers.
       */
     void after_iteration(int iteration, graphchi_context &ginfo) {
+        if (partition) {
+            partition->exchange(vertices_data);
+        }
     }
     
     /**
@@ -47,35 +72,44 @@ struct PagerankProgram : public GraphChiProgram<VertexDataType, EdgeDataType> {
       * Pagerank update function.
       */
     void update(graphchi_vertex<VertexDataType, EdgeDataType> &v, graphchi_context &ginfo) {
+        if (partition && ! partition->is_local(v.id())) {
+            return; // computed by another worker, the value is received in after_iteration
+        }
+        const int outc = out_degree(v);
         if (ginfo.iteration == 0) {
             /* On first iteration, initialize vertex and out-edges. 
                The initialization is important,
                because on every run, GraphChi will modify the data in the edges on disk. 
              */
-            if (v.outc > 0) {
-                vertices_data[v.id()].page_rank = 1.0f / v.outc;
+            if (outc > 0) {
+                vertices_data[v.id()].page_rank = 1.0f / outc;
             }
         } else {
+            const VerticesData& previous = synchronous ? previous_data : vertices_data;
             float sum_page_rank = 0;
             float sum_porn_rank = 0;
             float sum_trust_rank = 0;
             for (int i = 0; i < v.num_inedges(); i++) {
-                const auto& in_vertice_data = vertices_data[v.inedge(i)->vertexid];
+                const auto& in_vertice_data = previous[v.inedge(i)->vertexid];
                 sum_page_rank += in_vertice_data.page_rank;
                 sum_porn_rank += in_vertice_data.porn_rank;
                 sum_trust_rank += in_vertice_data.trust_rank;
             }
 
-            const auto& vertice_data = vertices_data[v.id()];
+            const auto& vertice_data = previous[v.id()];
             float page_rank;
-            if (v.outc > 0) {
-                page_rank = (RANDOMRESETPROB + (1 - RANDOMRESETPROB) * sum_page_rank) / v.outc;
+            if (outc > 0) {
+                page_rank = (RANDOMRESETPROB + (1 - RANDOMRESETPROB) * sum_page_rank) / outc;
             } else {
                 page_rank = (RANDOMRESETPROB + (1 - RANDOMRESETPROB) * sum_page_rank);
             }
 
-            float porn_rank = vertice_data.porn_rank + sum_porn_rank / 10; // dumb value for the moment
-            float trust_rank = vertice_data.trust_rank + sum_trust_rank / 10; // dumb value for the moment
+            float porn_rank = vertice_data.porn_rank;
+            float trust_rank = vertice_data.trust_rank;
+            if (label_propagation) {
+                porn_rank += sum_porn_rank / 10; // dumb value for the moment
+                trust_rank += sum_trust_rank / 10; // dumb value for the moment
+            }
             
             vertices_data[v.id()] = VertexDataType {
                 page_rank,
@@ -87,8 +121,8 @@ struct PagerankProgram : public GraphChiProgram<VertexDataType, EdgeDataType> {
             if (ginfo.iteration == ginfo.num_iterations - 1) { // NOTE: I think we can skip this part and use directly vertices_data as output
                 /* On last iteration, multiply pr by degree and store the result */
                 auto& v_data = vertices_data[v.id()];
-                if (v.outc) {
-                    v_data.page_rank *= v.outc;
+                if (outc) {
+                    v_data.page_rank *= outc;
                 }
                 v.set_data(v_data); 
             }
@@ -121,30 +155,149 @@ void publish_results(const Context& ctx, const std::string& filename, graphchi::
     }
 }
 
-int main(int argc, const char ** argv) {
-    graphchi::graphchi_init(argc, argv);
-    graphchi::metrics m("pagerank");
-    global_logger().set_log_level(LOG_DEBUG);
+/**
+  * Read the page ranks published by the previous run, used when only the labels are propagated again.
+  */
+void load_page_ranks(Context& ctx, const std::string& filename, graphchi::metrics& m) {
+    graphchi::stripedio iomgr(m);
+    vid_t readwindow = 1024 * 1024;
+    size_t numvertices = std::min<size_t>(graphchi::get_num_vertices(filename), ctx.vertices_data.size());
+    auto vertexdata = graphchi::vertex_data_store<VertexDataType>{filename, numvertices, &iomgr};
 
-    /* Parameters */
-    int niters              = get_option_int("niters", 4);
+    for (vid_t it_vertices = 0; it_vertices < numvertices; it_vertices += readwindow) {
+        vid_t end = std::min<size_t>(it_vertices + readwindow, numvertices);
+
+        vertexdata.load(it_vertices, end - 1);
+        for (vid_t v = it_vertices; v < end; v++) {
+            VertexDataType val = ctx.vertices_data[v];
+            val.page_rank = vertexdata.vertex_data_ptr(v)->page_rank;
+            ctx.vertices_data[v] = val;
+        }
+    }
+}
+
+/**
+  * Same output as publish_results, but from the vertices data gathered by the coordinator in partitioned mode
+  * (or computed by a labels only run).
+  */
+void publish_vertices_data(const Context& ctx) {
+    for (uint64_t v = 0; v < ctx.vertices_data.size(); v++) {
+        const VertexDataType& val = ctx.vertices_data[v];
+        const auto& uuid = ctx.vertices_uuid[v];
+
+        std::cout << " for graphchi id " << v << " uuid " << uuid << " value = " << val << std::endl;
+    }
+}
+
+PersonalizedParams personalized_params() {
+    PersonalizedParams params{RANDOMRESETPROB};
+    params.epsilon = graphchi::get_option_float("epsilon", params.epsilon);
+    return params;
+}
+
+void run_standalone(int niters, bool personalized, bool labels_only, bool synchronous, graphchi::metrics& m) {
     bool scheduler          = false;                    // Non-dynamic version of pagerank.
-    int ntop                = get_option_int("top", 20);
+
+    if (labels_only) {
+        /* Only the labels changed: reuse the graph, out-edges and page ranks of the previous personalized run */
+        Context ctx;
+        fetch_labels(ctx, get_option_string("worker_db"));
+        propagate_labels(ctx, personalized_params());
+        load_page_ranks(ctx, FILE_NAME, m);
+        publish_vertices_data(ctx);
+        return;
+    }
     
     /* Process input file - if not already preprocessed */
     Context ctx;
     int nshards             = fetch_data(ctx, get_option_string("nshards", "auto"),
                                                 get_option_string("worker_db"),
-                                                get_option_string("link_db"));
+                                                get_option_string("link_db"),
+                                                personalized);
+
+    if (personalized) {
+        propagate_labels(ctx, personalized_params());
+    }
 
     /* Run */
     graphchi::graphchi_engine<VertexDataType, EdgeDataType> engine(FILE_NAME, nshards, scheduler, m); 
     engine.set_modifies_inedges(false); // Improves I/O performance.
    
-    PagerankProgram program(ctx.vertices_data);
+    PagerankProgram program(ctx.vertices_data, ! personalized, synchronous);
     engine.run(program, niters);
     
     publish_results(ctx, FILE_NAME, m);
+}
+
+/**
+  * Partitioned mode, coordinator: split the import between the workers and publish their results.
+  */
+void run_coordinator(int niters, bool synchronous, const std::vector<std::string>& addresses) {
+    Context ctx;
+    std::vector<Socket> workers;
+    split_import(ctx, addresses, niters, synchronous, get_option_string("worker_db"), get_option_string("link_db"), workers);
+    collect_results(ctx, workers);
+
+    publish_vertices_data(ctx);
+}
+
+/**
+  * Partitioned mode, worker: run the rank update on the part of the graph sent by the coordinator.
+  */
+void run_worker(const std::vector<std::string>& addresses, graphchi::metrics& m) {
+    bool scheduler          = false;
+    Partition partition(get_option_int("worker_id"), addresses);
+
+    Context ctx;
+    int nshards             = fetch_partition(ctx, partition, get_option_string("nshards", "auto"));
+
+    graphchi::graphchi_engine<VertexDataType, EdgeDataType> engine(partition.file_name(), nshards, scheduler, m); 
+    engine.set_modifies_inedges(false); // Improves I/O performance.
+
+    PagerankProgram program(ctx.vertices_data, true, partition.synchronous, &partition);
+    engine.run(program, partition.niters);
+
+    send_results(partition, ctx.vertices_data);
+}
+
+int main(int argc, const char ** argv) {
+    graphchi::graphchi_init(argc, argv);
+    graphchi::metrics m("pagerank");
+    global_logger().set_log_level(LOG_DEBUG);
+
+    /* Parameters */
+    int niters              = get_option_int("niters", 4);
+    int ntop                = get_option_int("top", 20);
+    std::string mode        = get_option_string("mode", "standalone"); // standalone, coordinator or worker
+    bool personalized       = get_option_int("personalized", 0);  // Seed-driven push propagation of trust/porn ranks.
+    bool labels_only        = get_option_int("labels_only", 0);   // Only propagate the new labels on the graph of the previous personalized run.
+    bool synchronous        = get_option_int("synchronous", 0);   // Only read the values of the previous iteration (given to the coordinator in partitioned mode).
+
+    if (labels_only && ! personalized) {
+        std::cerr << "labels_only needs the personalized propagation" << std::endl;
+        return 1;
+    }
+    if (mode == "standalone") {
+        run_standalone(niters, personalized, labels_only, synchronous, m);
+    } else if (mode == "coordinator" || mode == "worker") {
+        if (personalized) {
+            std::cerr << "the personalized propagation is only available in standalone mode" << std::endl;
+            return 1;
+        }
+        const auto addresses = split_addresses(get_option_string("workers"));
+        if (addresses.empty()) {
+            std::cerr << "no worker address given, --workers is a comma separated list of unix:path or host:port" << std::endl;
+            return 1;
+        }
+        if (mode == "coordinator") {
+            run_coordinator(niters, synchronous, addresses);
+        } else {
+            run_worker(addresses, m);
+        }
+    } else {
+        std::cerr << "unknown mode " << mode << ", expected standalone, coordinator or worker" << std::endl;
+        return 1;
+    }
     
     metrics_report(m);    
     return 0;
@@ -1,4 +1,9 @@
 #pragma once
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <stxxl/map>
 
 #define DATA_NODE_BLOCK_SIZE (4096)
@@ -38,6 +43,78 @@ using VerticesData = stxxl::VECTOR_GENERATOR<VertexDataType>::result;
 using VerticesUuid = stxxl::VECTOR_GENERATOR<uuid_t>::result;
 using EdgeDataType = float; // for the moment it's a float, but it might become a more complex POD
 
+using Edge = std::pair<uint64_t, uint64_t>;
+
+struct EdgeCompare {
+    bool operator () (const Edge& a, const Edge& b) const { return a < b; }
+    static Edge min_value() { return {std::numeric_limits<uint64_t>::min(), std::numeric_limits<uint64_t>::min()}; }
+    static Edge max_value() { return {std::numeric_limits<uint64_t>::max(), std::numeric_limits<uint64_t>::max()}; }
+};
+
+using EdgeList = stxxl::VECTOR_GENERATOR<Edge>::result;
+using VerticesIdx = stxxl::VECTOR_GENERATOR<uint64_t>::result;
+
+/**
+  * Read only array stored in a binary file and mapped in memory,
+  * a random read only loads the page it needs.
+  */
+template <typename T>
+struct MappedArray {
+    const T* data = nullptr;
+    size_t count = 0;
+
+    MappedArray() = default;
+    MappedArray(const MappedArray&) = delete;
+    MappedArray& operator=(const MappedArray&) = delete;
+    ~MappedArray() { unmap(); }
+
+    void map(const std::string& path) {
+        unmap();
+        const int fd = ::open(path.c_str(), O_RDONLY);
+        struct stat st;
+        if (fd < 0 || ::fstat(fd, &st) < 0) {
+            if (fd >= 0) {
+                ::close(fd);
+            }
+            throw std::runtime_error("impossible to open " + path);
+        }
+        count = st.st_size / sizeof(T);
+        if (count > 0) {
+            void* addr = ::mmap(nullptr, count * sizeof(T), PROT_READ, MAP_SHARED, fd, 0);
+            if (addr == MAP_FAILED) {
+                ::close(fd);
+                throw std::runtime_error("impossible to map " + path);
+            }
+            data = static_cast<const T*>(addr);
+        }
+        ::close(fd);
+    }
+
+    void unmap() {
+        if (data) {
+            ::munmap(const_cast<T*>(data), count * sizeof(T));
+        }
+        data = nullptr;
+        count = 0;
+    }
+
+    size_t size() const { return count; }
+    const T& operator[](const size_t i) const { return data[i]; }
+};
+
+/**
+  * Out-edges of the graph in CSR form, needed by the push-style propagation 
+  * which only walks the neighbourhood of the active vertices.
+  * They are stored next to the shards so a run where only the labels changed can reuse them.
+  */
+struct OutEdges {
+    MappedArray<uint64_t> offsets{}; // out-neighbours of v are targets[offsets[v]] .. targets[offsets[v + 1] - 1]
+    MappedArray<uint64_t> targets{};
+
+    bool empty() const { return offsets.size() == 0; }
+    uint64_t degree(const uint64_t v) const { return offsets[v + 1] - offsets[v]; }
+};
+
 struct Context {
     Context(const uint64_t map_node_cache_size = VerticesIdMap::node_block_type::raw_size * 10, 
             const uint64_t map_leaf_cache_size = VerticesIdMap::leaf_block_type::raw_size * 10): 
@@ -46,4 +123,5 @@ struct Context {
     VerticesIdMap id_map; // used to associate an uuid to an internal graphchi ID
     VerticesData vertices_data{}; // used to initialize the graph
     VerticesUuid vertices_uuid{}; // used to find the original uuid at the end of the run
+    OutEdges out_edges{}; // only filled when the personalized propagation is asked
 };
\ No newline at end of file
@@ -0,0 +1,377 @@
+#pragma once
+
+#include <exception>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <thread>
+#include <unordered_map>
+#include "importer.hpp"
+#include "objects.hpp"
+#include "socket.hpp"
+
+/**
+  * Partitioned execution: the vertices are range partitioned across several worker processes.
+  *
+  * The coordinator reads the vertices and the edges, and sends to each worker its vertices
+  * and the in-edges of its vertices. Each worker shards and runs graphchi on its own part of the graph,
+  * the rank values of the boundary vertices (vertices with an out-edge toward another partition)
+  * are exchanged in one batch per peer after each iteration.
+  * At the end the workers send back their values to the coordinator which publishes them.
+  *
+  * A worker only knows its own vertices and the boundary vertices it reads (imports): they are
+  * renumbered with local ids, [0, local_count()) for the owned vertices and the imports after them,
+  * so the graphchi vertex data and degree files of a worker only cover its part of the graph.
+  *
+  * By default a worker reads its own vertices in place but the boundary vertices of its peers as of
+  * the previous iteration, so the results depend on the number of workers. With --synchronous=1
+  * (given to the coordinator) every read uses the previous iteration, the results are then the same
+  * as a standalone run with --synchronous=1 (up to the float summation order),
+  * scripts/check_partitioned.sh compares a 2 workers run with such a standalone run.
+  *
+  * All processes are given the same list of worker addresses (the position in the list is the worker id),
+  * for example on one host:
+  *
+  *   graphchi_handler --mode=worker --worker_id=0 --workers=unix:/tmp/gh0,unix:/tmp/gh1 &
+  *   graphchi_handler --mode=worker --worker_id=1 --workers=unix:/tmp/gh0,unix:/tmp/gh1 &
+  *   graphchi_handler --mode=coordinator --workers=unix:/tmp/gh0,unix:/tmp/gh1 --worker_db=... --link_db=...
+  *
+  * and with host:port addresses (tcp) on several nodes.
+  */
+
+const int32_t COORDINATOR_ID = -1;
+
+struct PartitionHeader {
+    uint64_t num_vertices;
+    int32_t niters;
+    int32_t nb_workers; // checked by the workers, all processes must be given the same worker list
+    int32_t synchronous;
+};
+
+struct VertexRange {
+    uint64_t begin;
+    uint64_t end;
+};
+
+struct BoundaryValue {
+    uint64_t vertex; // global id
+    VertexDataType data;
+};
+
+std::vector<std::string> split_addresses(const std::string& addresses) {
+    std::vector<std::string> res;
+    std::stringstream stream(addresses);
+    std::string address;
+    while (std::getline(stream, address, ',')) {
+        if (! address.empty()) {
+            res.push_back(address);
+        }
+    }
+    return res;
+}
+
+/**
+  * Worker w owns the vertices [first(w), first(w + 1)).
+  */
+struct PartitionRange {
+    uint64_t num_vertices = 0;
+    int32_t nb_workers = 1;
+
+    uint64_t first(const int32_t w) const { return num_vertices * w / nb_workers; }
+
+    int32_t owner(const uint64_t v) const {
+        int32_t w = std::min<int32_t>(nb_workers - 1, v * nb_workers / std::max<uint64_t>(num_vertices, 1));
+        while (w > 0 && first(w) > v) {
+            w--;
+        }
+        while (w < nb_workers - 1 && first(w + 1) <= v) {
+            w++;
+        }
+        return w;
+    }
+};
+
+/**
+  * Edges sorted by target, so the in-edges of each worker are contiguous.
+  */
+struct EdgeTargetCompare {
+    bool operator () (const Edge& a, const Edge& b) const {
+        return a.second < b.second || (a.second == b.second && a.first < b.first);
+    }
+    static Edge min_value() { return EdgeCompare::min_value(); }
+    static Edge max_value() { return EdgeCompare::max_value(); }
+};
+
+struct Partition: PartitionRange {
+    Partition(const int32_t worker_id, const std::vector<std::string>& addresses):
+        worker_id(worker_id), addresses(addresses) {
+        nb_workers = addresses.size();
+        if (worker_id < 0 || worker_id >= nb_workers) {
+            throw std::runtime_error("invalid worker id " + std::to_string(worker_id) + " for "
+                                     + std::to_string(nb_workers) + " workers");
+        }
+    }
+
+    int32_t worker_id;
+    std::vector<std::string> addresses;
+    int32_t niters = 0;
+    bool synchronous = false;
+
+    VerticesIdx out_degrees{}; // global out degree of the owned vertices, graphchi only sees the local edges
+    std::map<int32_t, std::vector<uint64_t>> exports{}; // owned boundary vertices (local ids) needed by each peer
+    std::unordered_map<uint64_t, uint64_t> imports{}; // global id -> local id of the boundary vertices read
+
+    Socket listener{};
+    Socket coordinator{};
+    std::map<int32_t, Socket> peers{};
+    std::map<int32_t, Socket> pending{}; // accepted connections not yet claimed
+
+    uint64_t begin() const { return first(worker_id); }
+    uint64_t end() const { return first(worker_id + 1); }
+    uint64_t local_count() const { return end() - begin(); }
+    bool is_local(const uint64_t local_id) const { return local_id < local_count(); }
+    uint64_t out_degree(const uint64_t local_id) const { return out_degrees[local_id]; }
+
+    /**
+      * Local id of a vertex, a remote vertex gets a new import id the first time it is seen.
+      */
+    uint64_t local_id(const uint64_t v) {
+        if (v >= begin() && v < end()) {
+            return v - begin();
+        }
+        auto it = imports.find(v);
+        if (it == imports.end()) {
+            it = imports.emplace(v, local_count() + imports.size()).first;
+        }
+        return it->second;
+    }
+
+    std::string file_name() const { return FILE_NAME + "_part" + std::to_string(worker_id); }
+
+    /**
+      * Accept the connections until the one from the given process is there.
+      */
+    Socket accept_from_process(const int32_t id) {
+        while (pending.find(id) == pending.end()) {
+            Socket s = accept_from(listener);
+            const auto from = recv_pod<int32_t>(s);
+            pending[from] = std::move(s);
+        }
+        Socket s = std::move(pending[id]);
+        pending.erase(id);
+        return s;
+    }
+
+    /**
+      * Each worker connects to the workers before it and accepts the connections of the ones after it.
+      */
+    void connect_peers() {
+        for (int32_t w = 0; w < worker_id; ++w) {
+            Socket s = connect_to(addresses[w]);
+            send_pod<int32_t>(s, worker_id);
+            peers[w] = std::move(s);
+        }
+        for (int32_t w = worker_id + 1; w < nb_workers; ++w) {
+            peers[w] = accept_from_process(w);
+        }
+        logstream(LOG_INFO) << "Worker " << worker_id << " connected to its " << peers.size() << " peers" << std::endl;
+    }
+
+    /**
+      * Send the boundary values to the peers and receive theirs.
+      * Called once per iteration, with one batch per peer.
+      */
+    void exchange(VerticesData& vertices_data) {
+        std::map<int32_t, std::vector<BoundaryValue>> outgoing;
+        for (const auto& peer: peers) {
+            auto& batch = outgoing[peer.first];
+            for (const uint64_t v: exports[peer.first]) {
+                batch.push_back(BoundaryValue{begin() + v, vertices_data[v]});
+            }
+        }
+
+        // the batches are sent from another thread, else two workers sending big batches to each other would block
+        std::exception_ptr send_error;
+        std::thread sender([&]() {
+            try {
+                for (const auto& batch: outgoing) {
+                    send_batch(peers.at(batch.first), batch.second);
+                }
+            } catch (...) {
+                send_error = std::current_exception();
+            }
+        });
+        std::map<int32_t, std::vector<BoundaryValue>> incoming;
+        try {
+            for (const auto& peer: peers) {
+                incoming[peer.first] = recv_batch<BoundaryValue>(peer.second);
+            }
+        } catch (...) {
+            sender.join();
+            throw;
+        }
+        sender.join();
+        if (send_error) {
+            std::rethrow_exception(send_error);
+        }
+
+        for (const auto& batch: incoming) {
+            for (const auto& val: batch.second) {
+                vertices_data[imports.at(val.vertex)] = val.data;
+            }
+        }
+    }
+};
+
+/**
+  * Coordinator side of the import: read the whole graph and send each worker its part.
+  * Edges are sent to the owner of their target, since a vertex is computed from its in-edges.
+  */
+void split_import(Context& ctx, const std::vector<std::string>& addresses, const int32_t niters, const bool synchronous,
+                    const std::string& worker_db_cnx, const std::string& link_db_cnx,
+                    std::vector<Socket>& workers) {
+    if (addresses.empty()) {
+        throw std::runtime_error("no worker address given");
+    }
+    const auto num_vertices = fetch_vertices(ctx, worker_db_cnx);
+    PartitionRange range;
+    range.num_vertices = num_vertices;
+    range.nb_workers = addresses.size();
+
+    for (const auto& address: addresses) {
+        workers.push_back(connect_to(address));
+        send_pod<int32_t>(workers.back(), COORDINATOR_ID);
+        send_pod(workers.back(), PartitionHeader{num_vertices, niters, range.nb_workers, synchronous});
+    }
+
+    // the owner of a vertex grows with its id, so once sorted the edges (by target) and
+    // the exports (by source) of each worker are contiguous, no need for one list per worker
+    EdgeList edges;
+    EdgeList exports; // (vertex, peer) pairs
+    VerticesIdx out_degrees;
+    out_degrees.reserve(num_vertices);
+    for (uint64_t v = 0; v < num_vertices; ++v) {
+        out_degrees.push_back(0);
+    }
+
+    fetch_edges(ctx.id_map, link_db_cnx, [&](const uint64_t from_idx, const uint64_t to_idx) {
+        out_degrees[from_idx]++;
+        edges.push_back(Edge{from_idx, to_idx});
+        const int32_t to_owner = range.owner(to_idx);
+        if (range.owner(from_idx) != to_owner) {
+            exports.push_back(Edge{from_idx, static_cast<uint64_t>(to_owner)});
+        }
+    });
+    stxxl::sort(edges.begin(), edges.end(), EdgeTargetCompare(), SORT_MEMORY);
+    stxxl::sort(exports.begin(), exports.end(), EdgeCompare(), SORT_MEMORY);
+    // a vertex with several edges toward the same peer needs to be sent only once
+    const auto exports_end = exports.cbegin() + (std::unique(exports.begin(), exports.end()) - exports.begin());
+
+    auto edges_it = edges.cbegin();
+    auto exports_it = exports.cbegin();
+    for (int32_t w = 0; w < range.nb_workers; ++w) {
+        const Socket& s = workers[w];
+        const uint64_t begin = range.first(w);
+        const uint64_t end = range.first(w + 1);
+        send_stream<VertexDataType>(s, ctx.vertices_data.cbegin() + begin, ctx.vertices_data.cbegin() + end);
+        send_stream<uint64_t>(s, out_degrees.cbegin() + begin, out_degrees.cbegin() + end);
+
+        // the exports go before the edges: the worker shards once it has all its edges,
+        // and we do not want to wait for it before moving on to the next worker
+        const auto worker_exports_end = std::lower_bound(exports_it, exports_end, end, [](const Edge& e, const uint64_t v) {
+            return e.first < v;
+        });
+        send_stream<Edge>(s, exports_it, worker_exports_end);
+        exports_it = worker_exports_end;
+
+        const auto edges_end = std::lower_bound(edges_it, edges.cend(), end, [](const Edge& e, const uint64_t v) {
+            return e.second < v;
+        });
+        send_stream<Edge>(s, edges_it, edges_end);
+        edges_it = edges_end;
+
+        logstream(LOG_INFO) << "Sent vertices [" << begin << ", " << end << ") to worker " << w << std::endl;
+    }
+}
+
+/**
+  * Coordinator side of the publish: gather the values of all the workers in the vertices data.
+  */
+void collect_results(Context& ctx, const std::vector<Socket>& workers) {
+    PartitionRange range;
+    range.num_vertices = ctx.vertices_data.size();
+    range.nb_workers = workers.size();
+    for (int32_t w = 0; w < range.nb_workers; ++w) {
+        const auto received = recv_pod<VertexRange>(workers[w]);
+        if (received.begin != range.first(w) || received.end != range.first(w + 1)) {
+            throw std::runtime_error("worker " + std::to_string(w) + " sent an unexpected vertex range");
+        }
+        uint64_t v = received.begin;
+        recv_stream<VertexDataType>(workers[w], [&](const VertexDataType& val) {
+            if (v >= received.end) {
+                throw std::runtime_error("worker " + std::to_string(w) + " sent too many values");
+            }
+            ctx.vertices_data[v++] = val;
+        });
+        if (v != received.end) {
+            throw std::runtime_error("worker " + std::to_string(w) + " sent too few values");
+        }
+    }
+}
+
+/**
+  * Worker side of the import: receive the local part of the graph from the coordinator and shard it.
+  * The vertices data only holds the owned vertices followed by the imported ones (local ids).
+  */
+int fetch_partition(Context& ctx, Partition& partition, const std::string& nshards_string) {
+    partition.listener = listen_on(partition.addresses[partition.worker_id]);
+    partition.coordinator = partition.accept_from_process(COORDINATOR_ID);
+    const Socket& s = partition.coordinator;
+
+    const auto header = recv_pod<PartitionHeader>(s);
+    if (header.nb_workers != partition.nb_workers) {
+        throw std::runtime_error("the coordinator has " + std::to_string(header.nb_workers) + " workers but this worker was given "
+                                 + std::to_string(partition.nb_workers) + ", all processes must use the same worker list");
+    }
+    partition.num_vertices = header.num_vertices;
+    partition.niters = header.niters;
+    partition.synchronous = header.synchronous;
+
+    ctx.vertices_data.reserve(partition.local_count());
+    recv_stream<VertexDataType>(s, [&](const VertexDataType& val) {
+        ctx.vertices_data.push_back(val);
+    });
+    recv_stream<uint64_t>(s, [&](const uint64_t degree) {
+        partition.out_degrees.push_back(degree);
+    });
+    assert(ctx.vertices_data.size() == partition.local_count());
+    assert(partition.out_degrees.size() == partition.local_count());
+    recv_stream<Edge>(s, [&](const Edge& e) {
+        partition.exports[e.second].push_back(partition.local_id(e.first));
+    });
+
+    const int nshards = shard(partition.file_name(), nshards_string, [&](graphchi::sharder<EdgeDataType>& sharder) {
+        recv_stream<Edge>(s, [&](const Edge& e) {
+            sharder.preprocessing_add_edge(partition.local_id(e.first), partition.local_id(e.second));
+        });
+        return partition.local_count() + partition.imports.size();
+    });
+    for (uint64_t i = 0; i < partition.imports.size(); ++i) {
+        ctx.vertices_data.push_back(VertexDataType{0, 0, 0});
+    }
+
+    logstream(LOG_INFO) << "Worker " << partition.worker_id << " owns vertices [" << partition.begin() << ", "
+                        << partition.end() << ") and reads " << partition.imports.size() << " boundary vertices" << std::endl;
+    partition.connect_peers();
+    return nshards;
+}
+
+/**
+  * Worker side of the publish: send the owned values back to the coordinator.
+  */
+void send_results(const Partition& partition, const VerticesData& vertices_data) {
+    send_pod(partition.coordinator, VertexRange{partition.begin(), partition.end()});
+    send_stream<VertexDataType>(partition.coordinator,
+                                vertices_data.cbegin(),
+                                vertices_data.cbegin() + partition.local_count());
+}
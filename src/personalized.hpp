@@ -0,0 +1,171 @@
+#pragma once
+
+#include <deque>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <graphchi_basic_includes.hpp>
+#include "objects.hpp"
+
+/**
+  * Seed-driven personalized propagation (push-style, Andersen-Chung-Lang).
+  *
+  * Instead of sweeping the whole graph, we keep for each vertex a residual
+  * mass that has not been propagated yet and only touch the vertices whose
+  * residual is above epsilon * out_degree, and their out-edges.
+  * The cost of the push is thus proportional to the neighbourhood of the seeds.
+  *
+  * Several seed sets can be run in the same batch: the residuals of all the sets
+  * are stored together so the out-edges of an active vertex are read only once.
+  *
+  * The out-edges are built by a full personalized run and stored next to the shards,
+  * a labels only run reuses them without importing, sharding or running graphchi.
+  * scripts/check_personalized.sh compares the result with a power iteration.
+  */
+
+using Seeds = std::vector<std::pair<uint64_t, float>>; // vertex idx -> seed weight
+using SparseRank = std::unordered_map<uint64_t, float>;
+
+struct PersonalizedParams {
+    float alpha; // teleport probability
+    float epsilon = 1e-4; // residual threshold (per out-edge, in label units) for a vertex to be active
+};
+
+/**
+  * Residual masses of a touched vertex for all the seed sets.
+  * The out degree is read once when the vertex is first touched, not at each push toward it.
+  */
+struct Residual {
+    uint64_t degree;
+    std::vector<float> masses;
+};
+
+/**
+  * Run the push propagation for all the seed sets at once.
+  * The seed weights are not normalized, so epsilon does not depend on the size of the seed set,
+  * and the residual left under the threshold is kept in the rank of its vertex:
+  * the total rank of a set is its total seed weight.
+  */
+std::vector<SparseRank> personalized_rank(const OutEdges& out_edges,
+                                            const std::vector<Seeds>& seed_sets,
+                                            const PersonalizedParams& params) {
+    const size_t nb_sets = seed_sets.size();
+    std::vector<SparseRank> ranks(nb_sets);
+
+    std::unordered_map<uint64_t, Residual> residuals;
+    std::deque<uint64_t> frontier;
+    std::unordered_set<uint64_t> in_frontier;
+
+    const auto is_active = [&](const float residual, const uint64_t degree) {
+        return residual >= params.epsilon * std::max<uint64_t>(degree, 1);
+    };
+    const auto residual_of = [&](const uint64_t v) -> Residual& {
+        auto it = residuals.find(v);
+        if (it == residuals.end()) {
+            it = residuals.emplace(v, Residual{out_edges.degree(v), std::vector<float>(nb_sets, 0)}).first;
+        }
+        return it->second;
+    };
+    const auto activate = [&](const uint64_t v) {
+        if (in_frontier.insert(v).second) {
+            frontier.push_back(v);
+        }
+    };
+
+    for (size_t s = 0; s < nb_sets; ++s) {
+        for (const auto& seed: seed_sets[s]) {
+            residual_of(seed.first).masses[s] += seed.second;
+            activate(seed.first);
+        }
+    }
+
+    uint64_t nb_pushes = 0;
+    std::vector<float> shares(nb_sets);
+    while (! frontier.empty()) {
+        const uint64_t u = frontier.front();
+        frontier.pop_front();
+        in_frontier.erase(u);
+
+        auto& residual = residual_of(u);
+        const uint64_t degree = residual.degree;
+        bool has_share = false;
+        for (size_t s = 0; s < nb_sets; ++s) {
+            shares[s] = 0;
+            const float r = residual.masses[s];
+            if (! is_active(r, degree)) {
+                continue;
+            }
+            residual.masses[s] = 0;
+            if (degree == 0) {
+                // dangling vertex, the mass has nowhere to go so we keep it there
+                ranks[s][u] += r;
+                continue;
+            }
+            ranks[s][u] += params.alpha * r;
+            shares[s] = (1 - params.alpha) * r / degree;
+            has_share = true;
+        }
+        if (! has_share) {
+            continue;
+        }
+        nb_pushes++;
+
+        const uint64_t begin = out_edges.offsets[u];
+        const uint64_t end = out_edges.offsets[u + 1];
+        for (uint64_t e = begin; e < end; ++e) {
+            const uint64_t v = out_edges.targets[e];
+            auto& v_residual = residual_of(v);
+            for (size_t s = 0; s < nb_sets; ++s) {
+                if (shares[s] == 0) {
+                    continue;
+                }
+                v_residual.masses[s] += shares[s];
+                if (is_active(v_residual.masses[s], v_residual.degree)) {
+                    activate(v);
+                }
+            }
+        }
+    }
+
+    for (const auto& residual: residuals) {
+        for (size_t s = 0; s < nb_sets; ++s) {
+            if (residual.second.masses[s] != 0) {
+                ranks[s][residual.first] += residual.second.masses[s];
+            }
+        }
+    }
+    logstream(LOG_INFO) << "Personalized propagation of " << nb_sets << " seed sets done in " << nb_pushes
+                        << " pushes, " << residuals.size() << " vertices touched" << std::endl;
+    return ranks;
+}
+
+/**
+  * The vertices with a positive trust/porn score in the scores table are the seeds.
+  * Both signals are run in the same batch and written back in the vertices data,
+  * the raw labels are replaced, so vertices not reached by the propagation end with no trust/porn rank.
+  */
+void propagate_labels(Context& ctx, const PersonalizedParams& params) {
+    std::vector<Seeds> seed_sets(2);
+    auto& trust_seeds = seed_sets[0];
+    auto& porn_seeds = seed_sets[1];
+    for (uint64_t v = 0; v < ctx.vertices_data.size(); ++v) {
+        VertexDataType& data = ctx.vertices_data[v];
+        if (data.trust_rank > 0) {
+            trust_seeds.emplace_back(v, data.trust_rank);
+        }
+        if (data.porn_rank > 0) {
+            porn_seeds.emplace_back(v, data.porn_rank);
+        }
+        data.trust_rank = 0;
+        data.porn_rank = 0;
+    }
+
+    const auto ranks = personalized_rank(ctx.out_edges, seed_sets, params);
+
+    for (const auto& rank: ranks[0]) {
+        ctx.vertices_data[rank.first].trust_rank = rank.second;
+    }
+    for (const auto& rank: ranks[1]) {
+        ctx.vertices_data[rank.first].porn_rank = rank.second;
+    }
+}
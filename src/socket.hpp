@@ -0,0 +1,249 @@
+#pragma once
+
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/**
+  * Minimal blocking stream sockets used to exchange data between the processes of a partitioned run.
+  *
+  * An address is either "unix:/some/path" for a local socket (several processes on one host)
+  * or "host:port" for TCP (several nodes).
+  */
+
+struct Socket {
+    int fd = -1;
+    std::string unix_path{}; // set for a unix listener, the socket file is removed when it is closed
+
+    Socket() = default;
+    explicit Socket(int fd): fd(fd) {}
+    Socket(const Socket&) = delete;
+    Socket& operator=(const Socket&) = delete;
+    Socket(Socket&& other): fd(other.fd), unix_path(std::move(other.unix_path)) {
+        other.fd = -1;
+        other.unix_path.clear();
+    }
+    Socket& operator=(Socket&& other) {
+        std::swap(fd, other.fd);
+        std::swap(unix_path, other.unix_path);
+        return *this;
+    }
+    ~Socket() {
+        if (fd >= 0) {
+            ::close(fd);
+        }
+        if (! unix_path.empty()) {
+            ::unlink(unix_path.c_str());
+        }
+    }
+};
+
+inline std::runtime_error socket_error(const std::string& what) {
+    return std::runtime_error(what + ": " + std::strerror(errno));
+}
+
+namespace detail {
+    const std::string UNIX_PREFIX = "unix:";
+
+    inline bool is_unix(const std::string& address) {
+        return address.compare(0, UNIX_PREFIX.size(), UNIX_PREFIX) == 0;
+    }
+
+    inline sockaddr_un unix_address(const std::string& address) {
+        const std::string path = address.substr(UNIX_PREFIX.size());
+        sockaddr_un addr{};
+        if (path.size() >= sizeof(addr.sun_path)) {
+            throw std::runtime_error("unix socket path too long: " + path);
+        }
+        addr.sun_family = AF_UNIX;
+        std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+        return addr;
+    }
+
+    inline addrinfo* tcp_address(const std::string& address, bool passive) {
+        const auto sep = address.rfind(':');
+        if (sep == std::string::npos) {
+            throw std::runtime_error("invalid address, expected host:port or unix:path: " + address);
+        }
+        const std::string host = address.substr(0, sep);
+        const std::string port = address.substr(sep + 1);
+        addrinfo hints{};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = passive ? AI_PASSIVE : 0;
+        addrinfo* res = nullptr;
+        const int err = ::getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &res);
+        if (err != 0) {
+            throw std::runtime_error("impossible to resolve " + address + ": " + ::gai_strerror(err));
+        }
+        return res;
+    }
+}
+
+inline Socket listen_on(const std::string& address) {
+    if (detail::is_unix(address)) {
+        const sockaddr_un addr = detail::unix_address(address);
+        ::unlink(addr.sun_path); // remove a stale socket of a previous run
+        Socket s{::socket(AF_UNIX, SOCK_STREAM, 0)};
+        if (s.fd < 0 || ::bind(s.fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) < 0
+            || ::listen(s.fd, SOMAXCONN) < 0) {
+            throw socket_error("impossible to listen on " + address);
+        }
+        s.unix_path = addr.sun_path;
+        return s;
+    }
+    addrinfo* res = detail::tcp_address(address, true);
+    Socket s{::socket(res->ai_family, res->ai_socktype, res->ai_protocol)};
+    const int yes = 1;
+    const bool ok = s.fd >= 0
+        && ::setsockopt(s.fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes)) == 0
+        && ::bind(s.fd, res->ai_addr, res->ai_addrlen) == 0
+        && ::listen(s.fd, SOMAXCONN) == 0;
+    ::freeaddrinfo(res);
+    if (! ok) {
+        throw socket_error("impossible to listen on " + address);
+    }
+    return s;
+}
+
+/**
+  * Connect to a peer, retrying for a while since the peer process might not be listening yet.
+  */
+inline Socket connect_to(const std::string& address, int nb_retries = 600) {
+    for (int retry = 0; ; ++retry) {
+        Socket s;
+        bool ok;
+        if (detail::is_unix(address)) {
+            const sockaddr_un addr = detail::unix_address(address);
+            s = Socket{::socket(AF_UNIX, SOCK_STREAM, 0)};
+            ok = s.fd >= 0 && ::connect(s.fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) == 0;
+        } else {
+            addrinfo* res = detail::tcp_address(address, false);
+            s = Socket{::socket(res->ai_family, res->ai_socktype, res->ai_protocol)};
+            ok = s.fd >= 0 && ::connect(s.fd, res->ai_addr, res->ai_addrlen) == 0;
+            ::freeaddrinfo(res);
+            const int yes = 1;
+            if (ok) {
+                ::setsockopt(s.fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+            }
+        }
+        if (ok) {
+            return s;
+        }
+        if (retry >= nb_retries) {
+            throw socket_error("impossible to connect to " + address);
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+}
+
+inline Socket accept_from(const Socket& listener) {
+    Socket s{::accept(listener.fd, nullptr, nullptr)};
+    if (s.fd < 0) {
+        throw socket_error("impossible to accept a connection");
+    }
+    return s;
+}
+
+inline void send_all(const Socket& s, const void* data, size_t size) {
+    const char* buf = static_cast<const char*>(data);
+    while (size > 0) {
+        const ssize_t n = ::send(s.fd, buf, size, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw socket_error("send failed");
+        }
+        buf += n;
+        size -= n;
+    }
+}
+
+inline void recv_all(const Socket& s, void* data, size_t size) {
+    char* buf = static_cast<char*>(data);
+    while (size > 0) {
+        const ssize_t n = ::recv(s.fd, buf, size, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            throw n == 0 ? std::runtime_error("connection closed by peer") : socket_error("recv failed");
+        }
+        buf += n;
+        size -= n;
+    }
+}
+
+template <typename T>
+void send_pod(const Socket& s, const T& val) {
+    send_all(s, &val, sizeof(T));
+}
+
+template <typename T>
+T recv_pod(const Socket& s) {
+    T val;
+    recv_all(s, &val, sizeof(T));
+    return val;
+}
+
+/**
+  * A batch is sent as its number of elements followed by the raw elements (T must be a POD).
+  */
+template <typename T>
+void send_batch(const Socket& s, const std::vector<T>& batch) {
+    send_pod<uint64_t>(s, batch.size());
+    send_all(s, batch.data(), batch.size() * sizeof(T));
+}
+
+template <typename T>
+std::vector<T> recv_batch(const Socket& s) {
+    std::vector<T> batch(recv_pod<uint64_t>(s));
+    recv_all(s, batch.data(), batch.size() * sizeof(T));
+    return batch;
+}
+
+const size_t STREAM_BATCH_SIZE = 64 * 1024;
+
+/**
+  * Send a sequence of unknown size as several batches, an empty batch marking the end of the stream.
+  */
+template <typename T, typename It>
+void send_stream(const Socket& s, It begin, It end) {
+    std::vector<T> batch;
+    batch.reserve(STREAM_BATCH_SIZE);
+    for (auto it = begin; it != end; ++it) {
+        batch.push_back(*it);
+        if (batch.size() == STREAM_BATCH_SIZE) {
+            send_batch(s, batch);
+            batch.clear();
+        }
+    }
+    if (! batch.empty()) {
+        send_batch(s, batch);
+    }
+    send_batch(s, std::vector<T>{});
+}
+
+template <typename T, typename OnValue>
+void recv_stream(const Socket& s, OnValue&& on_value) {
+    for (;;) {
+        const auto batch = recv_batch<T>(s);
+        if (batch.empty()) {
+            return;
+        }
+        for (const auto& val: batch) {
+            on_value(val);
+        }
+    }
+}